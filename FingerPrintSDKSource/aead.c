@@ -0,0 +1,71 @@
+#include "aead.h"
+#include <openssl/crypto.h>
+#include <string.h>
+
+//AES-128-GCM ON TOP OF LIBCRYPTO
+//every EVP call returns 1 on success, so the results are and-ed together
+
+const char *AeadVersion()
+{
+  return OpenSSL_version(OPENSSL_VERSION);
+}
+
+void AeadWipe(void *buffer, INT length)
+{
+  OPENSSL_cleanse(buffer, length);
+}
+
+//KEY BOTH CONTEXTS ONCE, EACH RECORD THEN ONLY SETS ITS NONCE
+//returns 0 if libcrypto cannot set the key up
+INT AeadSetKey(AEAD_KEY *key, const CHAR *raw)
+{
+  key->seal = EVP_CIPHER_CTX_new();
+  key->open = EVP_CIPHER_CTX_new();
+
+  if (key->seal != NULL && key->open != NULL &&
+      EVP_EncryptInit_ex(key->seal, EVP_aes_128_gcm(), NULL, raw, NULL) &&
+      EVP_DecryptInit_ex(key->open, EVP_aes_128_gcm(), NULL, raw, NULL))
+    return 1;
+
+  AeadFreeKey(key);
+  return 0;
+}
+
+//FORGET THE KEY, THE CONTEXTS ARE CLEANSED AS THEY ARE FREED
+void AeadFreeKey(AEAD_KEY *key)
+{
+  EVP_CIPHER_CTX_free(key->seal);
+  EVP_CIPHER_CTX_free(key->open);
+  key->seal = NULL;
+  key->open = NULL;
+}
+
+//ENCRYPT data IN PLACE AND WRITE THE FIRST tagLength BYTES OF THE TAG
+INT AeadSeal(const AEAD_KEY *key, const CHAR *nonce, const CHAR *aad, INT aadLength,
+             CHAR *data, INT length, CHAR *tag, INT tagLength)
+{
+  int n;
+
+  return EVP_EncryptInit_ex(key->seal, NULL, NULL, NULL, nonce) &&
+         EVP_EncryptUpdate(key->seal, NULL, &n, aad, aadLength) &&
+         EVP_EncryptUpdate(key->seal, data, &n, data, length) &&
+         EVP_EncryptFinal_ex(key->seal, data + length, &n) &&
+         EVP_CIPHER_CTX_ctrl(key->seal, EVP_CTRL_GCM_GET_TAG, tagLength, tag);
+}
+
+//DECRYPT data IN PLACE, RETURNS 0 (AND WIPES data) IF THE TAG DOES NOT CHECK
+INT AeadOpen(const AEAD_KEY *key, const CHAR *nonce, const CHAR *aad, INT aadLength,
+             CHAR *data, INT length, const CHAR *tag, INT tagLength)
+{
+  int n;
+
+  if (EVP_DecryptInit_ex(key->open, NULL, NULL, NULL, nonce) &&
+      EVP_CIPHER_CTX_ctrl(key->open, EVP_CTRL_GCM_SET_TAG, tagLength, (void *)tag) &&
+      EVP_DecryptUpdate(key->open, NULL, &n, aad, aadLength) &&
+      EVP_DecryptUpdate(key->open, data, &n, data, length) &&
+      EVP_DecryptFinal_ex(key->open, data + length, &n) > 0)
+    return 1;
+
+  AeadWipe(data, length);
+  return 0;
+}
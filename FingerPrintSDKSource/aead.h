@@ -0,0 +1,30 @@
+#ifndef AEAD_H
+#define AEAD_H
+
+#include "command.h"
+#include <openssl/evp.h>
+
+//AES-128-GCM SIZES (BYTES)
+#define AEAD_KEY_LENGTH 16
+#define AEAD_NONCE_LENGTH 12
+#define AEAD_TAG_LENGTH 16
+
+//libcrypto picks AES-NI, the ARMv8 crypto extensions or a constant-time
+//software implementation at run time; the contexts hold the key schedule
+typedef struct
+{
+	EVP_CIPHER_CTX *seal;
+	EVP_CIPHER_CTX *open;
+} AEAD_KEY;
+
+//FUNCTION DEFINITION
+INT AeadSetKey(AEAD_KEY *key, const CHAR *raw);
+void AeadFreeKey(AEAD_KEY *key);
+INT AeadSeal(const AEAD_KEY *key, const CHAR *nonce, const CHAR *aad, INT aadLength,
+             CHAR *data, INT length, CHAR *tag, INT tagLength);
+INT AeadOpen(const AEAD_KEY *key, const CHAR *nonce, const CHAR *aad, INT aadLength,
+             CHAR *data, INT length, const CHAR *tag, INT tagLength);
+void AeadWipe(void *buffer, INT length);
+const char *AeadVersion();
+
+#endif
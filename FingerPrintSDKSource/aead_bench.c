@@ -0,0 +1,201 @@
+//TEMPLATE SEALING BENCHMARK
+//checks the AES-128-GCM wrapper around libcrypto against the GCM spec test
+//vectors, then seals a template as BLE-sized records for a range of notify
+//payloads and compares the time with what the UART and the BLE link need to
+//move the same bytes. needs no module.
+//
+//  make aead_bench
+
+#include "stdio.h"
+#include "stdlib.h"
+#include <fcntl.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "template.h"
+
+#define TEMPLATE_SIZE 498
+#define ITERATIONS 20000
+#define KEY_TEMPLATE "/tmp/aead_bench.XXXXXX"
+
+//SHORTEST BLE CONNECTION INTERVAL; AT BEST A FEW NOTIFIES GO OUT PER INTERVAL
+#define BLE_INTERVAL_US 7500.0
+
+typedef struct
+{
+  const char *key, *nonce, *aad, *plain, *cipher, *tag;
+} VECTOR;
+
+//GCM SPEC (MCGREW & VIEGA) TEST CASES 1-4
+static const VECTOR vectors[] = {
+    {"00000000000000000000000000000000", "000000000000000000000000", "", "", "",
+     "58e2fccefa7e3061367f1d57a4e7455a"},
+    {"00000000000000000000000000000000", "000000000000000000000000", "",
+     "00000000000000000000000000000000", "0388dace60b6a392f328c2b971b2fe78",
+     "ab6e47d42cec13bdf53a67b21257bddf"},
+    {"feffe9928665731c6d6a8f9467308308", "cafebabefacedbaddecaf888", "",
+     "d9313225f88406e5a55909c5aff5269a86a7a9531534f7da2e4c303d8a318a721c3c0c95956809532fcf0e2449a6b525b16aedf5aa0de657ba637b391aafd255",
+     "42831ec2217774244b7221b784d0d49ce3aa212f2c02a4e035c17e2329aca12e21d514b25466931c7d8f6a5aac84aa051ba30b396a0aac973d58e091473f5985",
+     "4d5c2af327cd64a62cf35abd2ba6fab4"},
+    {"feffe9928665731c6d6a8f9467308308", "cafebabefacedbaddecaf888", "feedfacedeadbeeffeedfacedeadbeefabaddad2",
+     "d9313225f88406e5a55909c5aff5269a86a7a9531534f7da2e4c303d8a318a721c3c0c95956809532fcf0e2449a6b525b16aedf5aa0de657ba637b39",
+     "42831ec2217774244b7221b784d0d49ce3aa212f2c02a4e035c17e2329aca12e21d514b25466931c7d8f6a5aac84aa051ba30b396a0aac973d58e091",
+     "5bc94fbc3221a5db94fae95ae7121a47"},
+};
+
+#define VECTOR_COUNT (sizeof(vectors) / sizeof(vectors[0]))
+
+//NOTIFY PAYLOADS: DEFAULT ATT MTU, TYPICAL PHONE MTUS, THE RECORD LIMIT
+static const INT payloads[] = {20, 64, 182, 244, TEMPLATE_PAYLOAD_MAX};
+
+#define PAYLOAD_COUNT (sizeof(payloads) / sizeof(payloads[0]))
+
+static INT FromHex(const char *hex, CHAR *out)
+{
+  INT n = 0;
+
+  for (; hex[0] && hex[1]; hex += 2)
+  {
+    unsigned int byte;
+    sscanf(hex, "%2x", &byte);
+    out[n++] = (CHAR)byte;
+  }
+  return n;
+}
+
+static double Seconds()
+{
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return t.tv_sec + t.tv_nsec / 1e9;
+}
+
+//SEAL AND OPEN EVERY TEST VECTOR
+static INT CheckVectors()
+{
+  CHAR key[16], nonce[12], aad[64], plain[64], cipher[64], tag[16], data[64], out[16];
+  AEAD_KEY k;
+  INT i, aadLength, length;
+
+  for (i = 0; i < VECTOR_COUNT; i++)
+  {
+    FromHex(vectors[i].key, key);
+    FromHex(vectors[i].nonce, nonce);
+    FromHex(vectors[i].tag, tag);
+    aadLength = FromHex(vectors[i].aad, aad);
+    length = FromHex(vectors[i].plain, plain);
+    FromHex(vectors[i].cipher, cipher);
+
+    if (!AeadSetKey(&k, key))
+    {
+      printf("Test case %u: key setup failed\n", i + 1);
+      return 0;
+    }
+
+    memcpy(data, plain, length);
+    if (!AeadSeal(&k, nonce, aad, aadLength, data, length, out, sizeof(out)) ||
+        memcmp(data, cipher, length) || memcmp(out, tag, sizeof(tag)))
+    {
+      printf("Test case %u: seal mismatch\n", i + 1);
+      return 0;
+    }
+
+    if (!AeadOpen(&k, nonce, aad, aadLength, data, length, tag, sizeof(tag)) ||
+        memcmp(data, plain, length))
+    {
+      printf("Test case %u: open failed\n", i + 1);
+      return 0;
+    }
+
+    //a truncated tag, as the records carry, checks too
+    memcpy(data, cipher, length);
+    if (!AeadOpen(&k, nonce, aad, aadLength, data, length, tag, 8) ||
+        memcmp(data, plain, length))
+    {
+      printf("Test case %u: open with 8 byte tag failed\n", i + 1);
+      return 0;
+    }
+
+    memcpy(data, cipher, length);
+    tag[0] ^= 1;
+    if (AeadOpen(&k, nonce, aad, aadLength, data, length, tag, sizeof(tag)))
+    {
+      printf("Test case %u: forged tag accepted\n", i + 1);
+      return 0;
+    }
+    AeadFreeKey(&k);
+  }
+  return 1;
+}
+
+int main()
+{
+  CHAR raw[AEAD_KEY_LENGTH], frame[TEMPLATE_FRAME_MAX];
+  char keyFile[] = KEY_TEMPLATE;
+  TEMPLATE_STREAM stream;
+  double start, seconds;
+  INT i, j, n, offset, records;
+  int sink, keyFd;
+
+  if (!CheckVectors())
+    return 1;
+  printf("%s, GCM test vectors pass\n\n", AeadVersion());
+
+  for (i = 0; i < sizeof(raw); i++)
+    raw[i] = (CHAR)(i * 29 + 7);
+  //a fresh 0600 file of our own, never a name another process could plant
+  keyFd = mkstemp(keyFile);
+  if (keyFd == -1 || write(keyFd, raw, sizeof(raw)) != sizeof(raw))
+  {
+    printf("Cannot write %s\n", keyFile);
+    if (keyFd != -1)
+      unlink(keyFile);
+    return 1;
+  }
+  close(keyFd);
+
+  //records are written for real, to /dev/null, so framing and the write
+  //syscall are in the numbers too
+  sink = open("/dev/null", O_WRONLY);
+
+  printf("%7s %7s %10s %10s %8s %13s %14s\n", "payload", "records", "us/tpl", "us/record",
+         "MB/s", "UART 9600 ms", "UART 115k2 ms");
+  for (i = 0; i < PAYLOAD_COUNT; i++)
+  {
+    //one stream per template, as Enroll3 does: a fresh salt each time, so
+    //no nonce is ever used twice and the key setup is in the numbers too
+    records = 0;
+    start = Seconds();
+    for (j = 0; j < ITERATIONS; j++)
+    {
+      if (!TemplateStreamOpen(&stream, keyFile, sink, payloads[i]))
+      {
+        printf("Cannot open stream\n");
+        unlink(keyFile);
+        return 1;
+      }
+      for (offset = 0; offset < TEMPLATE_SIZE; offset += n)
+      {
+        n = TemplateRecordLength(&stream);
+        if (n > TEMPLATE_SIZE - offset)
+          n = TEMPLATE_SIZE - offset;
+        memset(frame + TEMPLATE_FRAME_DATA, (CHAR)offset, n);
+        TemplateStreamSeal(&stream, frame, n, offset + n == TEMPLATE_SIZE);
+        records++;
+      }
+      TemplateStreamClose(&stream);
+    }
+    seconds = Seconds() - start;
+
+    //10 bits per byte on the UART (start, 8 data, stop), plus the packet framing
+    printf("%7u %7u %10.2f %10.3f %8.1f %13.0f %14.1f\n", payloads[i], records / ITERATIONS,
+           seconds * 1e6 / ITERATIONS, seconds * 1e6 / records, TEMPLATE_SIZE * ITERATIONS / seconds / 1e6,
+           (TEMPLATE_SIZE + 6) * 10 * 1e3 / 9600, (TEMPLATE_SIZE + 6) * 10 * 1e3 / 115200);
+  }
+
+  printf("\nBLE sends at most a few notifies per %.1f ms connection interval\n", BLE_INTERVAL_US / 1000);
+
+  close(sink);
+  unlink(keyFile);
+  return 0;
+}
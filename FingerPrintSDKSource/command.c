@@ -1,14 +1,29 @@
 #include "define.h"
+#include "state.h"
+#include "template.h"
 #include "stdio.h"
 #include "stdlib.h"
 #include "wiringPi.h"
 #include "wiringSerial.h"
 #include <string.h>
+#include <sys/stat.h>
 
 int var; //for raspberry UART handle
+INT uartBaud = UART_BAUD; //rate the UART and the module are talking at
+LONG returnParameter;
+SHORT returnAck;
 
-//FILE POINTER
-FILE *pFile;
+COMMAND_PACKET commandPacket;
+DATA_PACKET dataPacket;
+
+//STATE-ONLY COMMANDS WAITING TO BE SENT TOGETHER
+#define COMMAND_QUEUE_LENGTH 4
+COMMAND_PACKET commandQueue[COMMAND_QUEUE_LENGTH];
+INT queued = 0;
+
+CHAR imageData[IMAGE_SIZE]; //last image fetched with GetImage()
+
+SHORT CalcChkSumOfCmdAckPkt(COMMAND_PACKET *pPkt);
 
 //SEND COMMAND (TALKING)
 void sendCommand(CHAR *Data, INT length)
@@ -18,6 +33,40 @@ void sendCommand(CHAR *Data, INT length)
     serialPutchar(var, *(Data + i));
 }
 
+//PUT THE MODULE BACK AT ITS POWER-ON RATE WITHOUT WAITING FOR AN ANSWER
+//used on the way out after a timeout, so the next invocation can still talk
+//to it at UART_BAUD
+static void restoreBaudRate()
+{
+  COMMAND_PACKET packet;
+
+  if (uartBaud == UART_BAUD)
+    return;
+
+  packet.start1 = COMMAND_START_CODE1;
+  packet.start2 = COMMAND_START_CODE2;
+  packet.deviceId = DEVICE_ID;
+  packet.parameter = UART_BAUD;
+  packet.command = CHANGE_BAUDRATE;
+  packet.checkSum = CalcChkSumOfCmdAckPkt(&packet);
+  sendCommand(&packet.start1, COMMAND_PACKAGE_LENGTH);
+
+  delay(100);
+  serialClose(var);
+  var = serialOpen(UART_DEVICE, UART_BAUD);
+  uartBaud = UART_BAUD;
+}
+
+//NO ANSWER FROM THE MODULE, GIVE UP
+static void moduleTimeout()
+{
+  printf("No Fingerprint Module Detected\n");
+  restoreBaudRate();
+  InvalidateState();
+  SaveState();
+  exit(0);
+}
+
 //RECIEVE COMMAND (LISTENING)
 void receiveCommand(CHAR *Data, INT length)
 {
@@ -38,14 +87,55 @@ void receiveCommand(CHAR *Data, INT length)
       delay(10);
       time_out++;
       if (time_out == 300)
-      {
-        printf("No Fingerprint Module Detected\n");
-        exit(0);
-      }
+        moduleTimeout();
     }
   } while (i < length); //check total package length
 }
 
+//RECIEVE PART OF A DATA PACKET
+//long transfers keep trickling in at UART speed, so the timeout only counts
+//time without any new byte
+void receiveBytes(CHAR *Data, INT length)
+{
+  INT i;
+
+  for (i = 0; i < length;)
+  {
+    INT time_out = 0;
+
+    while (serialDataAvail(var) <= 0)
+    {
+      delay(10);
+      if (++time_out == 300)
+        moduleTimeout();
+    }
+
+    while (i < length && serialDataAvail(var) > 0)
+      Data[i++] = serialGetchar(var);
+  }
+}
+
+//RECIEVE DATA PACKET STRAIGHT INTO A BUFFER
+//returns 0 if the packet checksum does not match
+INT receiveData(CHAR *Data, INT length)
+{
+  CHAR header[4], trailer[2];
+  SHORT checkSum = 0;
+  INT i;
+
+  receiveCommand(header, sizeof(header));
+  receiveBytes(Data, length);
+  receiveCommand(trailer, sizeof(trailer));
+
+  for (i = 0; i < sizeof(header); i++)
+    checkSum += header[i];
+  for (i = 0; i < length; i++)
+    checkSum += Data[i];
+
+  return header[0] == DATA_START_CODE1 && header[1] == DATA_START_CODE2 &&
+         checkSum == (SHORT)(trailer[0] | (trailer[1] << 8));
+}
+
 //CHECK SUM CALCULATION FOR COMMAND PACKET
 SHORT CalcChkSumOfCmdAckPkt(COMMAND_PACKET *pPkt)
 {
@@ -72,63 +162,151 @@ SHORT CalcChkSumOfDataPkt(DATA_PACKET *pPkt)
   return checkSum;
 }
 
+//SEND THE QUEUED COMMANDS IN ORDER, EACH ONE WAITING FOR ITS OWN ACK
+//the module answers one command at a time, so nothing is pipelined; the queue
+//only saves the commands it dropped. returnAck/returnParameter report the
+//first NACK, if any
+void FlushCommands()
+{
+  COMMAND_PACKET ackPacket;
+  INT i, count = queued;
+
+  if (count == 0)
+    return;
+  queued = 0;
+
+  moduleState.sent += count;
+  returnAck = ACK;
+  returnParameter = 0;
+
+  for (i = 0; i < count; i++)
+  {
+    sendCommand(&commandQueue[i].start1, COMMAND_PACKAGE_LENGTH);
+    receiveCommand(&ackPacket.start1, COMMAND_PACKAGE_LENGTH);
+    if (ackPacket.command != ACK && returnAck == ACK)
+    {
+      returnAck = ackPacket.command;
+      returnParameter = ackPacket.parameter;
+    }
+    UpdateState(commandQueue[i].command, commandQueue[i].parameter, ackPacket.command);
+  }
+}
+
+//QUEUE A COMMAND THAT ONLY CHANGES MODULE STATE (OPEN/CLOSE/CMOSLED)
+//it is dropped when the model says its effect is already in place, and a new
+//LED command replaces a queued one, so LED_close() then LED_open() costs
+//nothing while the LED is on. queued commands go out before the next command
+//that needs an answer, or at FlushCommands().
+void queueCommand(SHORT command, LONG parameter)
+{
+  INT i;
+
+  moduleState.requested++;
+  returnAck = ACK;
+  returnParameter = 0;
+
+  if (command == CMOSLED)
+  {
+    for (i = 0; i < queued; i++)
+    {
+      if (commandQueue[i].command == CMOSLED)
+      {
+        for (; i + 1 < queued; i++)
+          commandQueue[i] = commandQueue[i + 1];
+        queued--;
+        break;
+      }
+    }
+    if (moduleState.led == (parameter ? 1 : 0))
+      return;
+  }
+  else if (command == OPEN && moduleState.open == 1)
+    return;
+  else if (command == CLOSE && moduleState.open == 0)
+    return;
+
+  if (queued == COMMAND_QUEUE_LENGTH)
+    FlushCommands();
+
+  commandQueue[queued].start1 = COMMAND_START_CODE1;
+  commandQueue[queued].start2 = COMMAND_START_CODE2;
+  commandQueue[queued].deviceId = DEVICE_ID;
+  commandQueue[queued].parameter = parameter;
+  commandQueue[queued].command = command;
+  commandQueue[queued].checkSum = CalcChkSumOfCmdAckPkt(&commandQueue[queued]);
+  queued++;
+}
+
 //SEND & RECIEVE COMMAND
 void send_receive_command()
 {
+  SHORT command = commandPacket.command;
+  LONG parameter = commandPacket.parameter;
+
+  FlushCommands();
+
   sendCommand(&commandPacket.start1, COMMAND_PACKAGE_LENGTH);
   receiveCommand(&commandPacket.start1, COMMAND_PACKAGE_LENGTH);
 
   returnParameter = commandPacket.parameter;
   returnAck = commandPacket.command;
+
+  UpdateState(command, parameter, returnAck);
+  moduleState.requested++;
+  moduleState.sent++;
 }
 
 //FUNCTION DOCUMENTATION
 void Open()
 {
-  commandPacket.start1 = COMMAND_START_CODE1;
-  commandPacket.start2 = COMMAND_START_CODE2;
-  commandPacket.deviceId = DEVICE_ID;
-  commandPacket.parameter = 0x00000000;
-  commandPacket.command = OPEN;
-  commandPacket.checkSum = CalcChkSumOfCmdAckPkt(&commandPacket);
-
-  send_receive_command();
+  queueCommand(OPEN, 0x00000000);
 }
 
 void Close()
 {
+  queueCommand(CLOSE, 0x00000000);
+}
+
+//SWITCH THE MODULE AND THE UART TO ANOTHER BAUD RATE
+//the module acknowledges at the old rate and then changes, so the port is
+//reopened at the new one. returns 0 if the module refuses, the UART then
+//stays at the old rate
+INT ChangeBaudRate(INT baud)
+{
+  if (baud == uartBaud)
+    return 1;
+
   commandPacket.start1 = COMMAND_START_CODE1;
   commandPacket.start2 = COMMAND_START_CODE2;
   commandPacket.deviceId = DEVICE_ID;
-  commandPacket.parameter = 0x00000000;
-  commandPacket.command = CLOSE;
+  commandPacket.parameter = baud;
+  commandPacket.command = CHANGE_BAUDRATE;
   commandPacket.checkSum = CalcChkSumOfCmdAckPkt(&commandPacket);
 
   send_receive_command();
+  if (returnAck != ACK)
+    return 0;
+
+  //let the ACK drain before the line changes speed
+  delay(50);
+  serialClose(var);
+  if ((var = serialOpen(UART_DEVICE, baud)) < 0)
+  {
+    fprintf(stderr, "Raspberry-UART error!\n");
+    exit(0);
+  }
+  uartBaud = baud;
+  return 1;
 }
 
 void LED_open()
 {
-  commandPacket.start1 = COMMAND_START_CODE1;
-  commandPacket.start2 = COMMAND_START_CODE2;
-  commandPacket.deviceId = DEVICE_ID;
-  commandPacket.parameter = 0x00000001;
-  commandPacket.command = CMOSLED;
-  commandPacket.checkSum = CalcChkSumOfCmdAckPkt(&commandPacket);
-
-  send_receive_command();
+  queueCommand(CMOSLED, 0x00000001);
 }
 
 void LED_close()
 {
-  commandPacket.start1 = COMMAND_START_CODE1;
-  commandPacket.start2 = COMMAND_START_CODE2;
-  commandPacket.deviceId = DEVICE_ID;
-  commandPacket.parameter = 0x00000000;
-  commandPacket.command = CMOSLED;
-  commandPacket.checkSum = CalcChkSumOfCmdAckPkt(&commandPacket);
-
-  send_receive_command();
+  queueCommand(CMOSLED, 0x00000000);
 }
 
 void EnrollStart(int specify_ID)
@@ -165,8 +343,77 @@ void Enroll2()
   send_receive_command();
 }
 
-void Enroll3()
+//STREAM THE TEMPLATE DATA PACKET OUT AS SEALED RECORDS
+//each record's bytes are read from the UART straight into the frame they are
+//sealed and written from, so the template is never whole in memory or on
+//disk. the last record is held back until the packet checksum is good.
+static INT streamTemplate(TEMPLATE_STREAM *stream)
 {
+  CHAR frame[TEMPLATE_FRAME_MAX], header[4], trailer[2];
+  CHAR *data = frame + TEMPLATE_FRAME_DATA;
+  SHORT checkSum = 0;
+  INT i, n, offset, ok = 1;
+
+  receiveCommand(header, sizeof(header));
+  if (header[0] != DATA_START_CODE1 || header[1] != DATA_START_CODE2)
+    return 0;
+  for (i = 0; i < sizeof(header); i++)
+    checkSum += header[i];
+
+  for (offset = 0; ok && offset < TEMPLATE_SIZE; offset += n)
+  {
+    n = TemplateRecordLength(stream);
+    if (n > TEMPLATE_SIZE - offset)
+      n = TEMPLATE_SIZE - offset;
+
+    receiveBytes(data, n);
+    for (i = 0; i < n; i++)
+      checkSum += data[i];
+
+    if (offset + n == TEMPLATE_SIZE)
+    {
+      receiveCommand(trailer, sizeof(trailer));
+      if (checkSum != (SHORT)(trailer[0] | (trailer[1] << 8)))
+      {
+        ok = 0;
+        break;
+      }
+    }
+
+    ok = TemplateStreamSeal(stream, frame, n, offset + n == TEMPLATE_SIZE);
+  }
+
+  AeadWipe(frame, sizeof(frame));
+  return ok;
+}
+
+//ENROLL3, TEMPLATE SEALED ON THE WAY OUT TO TEMPLATE_FD
+//payload is the notify payload size the records are cut to
+void Enroll3(INT payload)
+{
+  TEMPLATE_STREAM stream;
+  struct stat target;
+  INT ok;
+
+  //the records need a pipe or socket handed over by the caller. an open fd 3
+  //alone proves nothing: wiringPiSetup() leaves /dev/gpiomem there, and when
+  //fd 3 was free the UART itself got it
+  if (var == TEMPLATE_FD || fstat(TEMPLATE_FD, &target) == -1 ||
+      !(S_ISFIFO(target.st_mode) || S_ISSOCK(target.st_mode)))
+  {
+    returnAck = NACK;
+    returnParameter = NACK_TEMPLATE_STREAM;
+    return;
+  }
+
+  //no key means no way to send the template, so leave the module untouched
+  if (!TemplateStreamOpen(&stream, TEMPLATE_KEY_FILE, TEMPLATE_FD, payload))
+  {
+    returnAck = NACK;
+    returnParameter = NACK_TEMPLATE_KEY;
+    return;
+  }
+
   commandPacket.start1 = COMMAND_START_CODE1;
   commandPacket.start2 = COMMAND_START_CODE2;
   commandPacket.deviceId = DEVICE_ID;
@@ -177,44 +424,29 @@ void Enroll3()
 
   if (returnAck != ACK)
   {
+    TemplateStreamClose(&stream);
     delay(500);
     printf("Enrollment Could Not Be Completed\n");
     return;
   }
 
-  if (returnAck == ACK)
-  {
-    receiveCommand(&dataPacket.start1, DATA_PACKAGE_LENGTH); //read template to receive buffer from fingeprint module
-
-    char filename[64];
-
-    sprintf(filename, "./%s.bin", "tpl");
-    pFile = fopen(filename, "w");
-    if (NULL == pFile)
-    {
-      delay(500);
-      printf("Open failure");
-      return;
-    }
-    else
-      fwrite(dataPacket.data, 1, sizeof(dataPacket.data), pFile);
+  ok = streamTemplate(&stream);
+  TemplateStreamClose(&stream);
+  LED_close();
 
-    fclose(pFile);
-    LED_close();
-  }
-  else
+  //the module has stored the finger, but the receiver never got a last record
+  if (!ok)
   {
-    if (returnParameter >= 0 && returnParameter <= 199)
-      printf("Enroll Failed: Duplicate Finger\n");
-    else
-    {
-      printf("Enroll Failed! Try Again\n");
-    }
+    returnAck = NACK;
+    returnParameter = NACK_TEMPLATE_STREAM;
   }
 }
 
+//ALWAYS A ROUND TRIP: ONLY THE MODULE KNOWS WHETHER A FINGER IS ON IT NOW
 void IsPressFinger()
 {
+  LED_open(); //the sensor needs the LED, see CaptureFinger()
+
   commandPacket.start1 = COMMAND_START_CODE1;
   commandPacket.start2 = COMMAND_START_CODE2;
   commandPacket.deviceId = DEVICE_ID;
@@ -225,8 +457,13 @@ void IsPressFinger()
   send_receive_command();
 }
 
+//the LED is asked for on every capture: that costs nothing while the model
+//knows it is on, and re-sends it once a NACK or a timeout made it unknown,
+//so retry loops never capture with the LED off
 void CaptureFinger(LONG picture_quality)
 {
+  LED_open();
+
   commandPacket.start1 = COMMAND_START_CODE1;
   commandPacket.start2 = COMMAND_START_CODE2;
   commandPacket.deviceId = DEVICE_ID;
@@ -236,3 +473,48 @@ void CaptureFinger(LONG picture_quality)
 
   send_receive_command();
 }
+
+//FETCH THE IMAGE TAKEN BY THE LAST CaptureFinger() INTO imageData
+void GetImage()
+{
+  commandPacket.start1 = COMMAND_START_CODE1;
+  commandPacket.start2 = COMMAND_START_CODE2;
+  commandPacket.deviceId = DEVICE_ID;
+  commandPacket.parameter = 0x00000000;
+  commandPacket.command = GET_IMAGE;
+  commandPacket.checkSum = CalcChkSumOfCmdAckPkt(&commandPacket);
+
+  send_receive_command();
+
+  if (returnAck == ACK && !receiveData(imageData, IMAGE_SIZE))
+  {
+    fprintf(stderr, "Image Checksum Error\n"); //stdout carries the result only
+    returnAck = NACK;
+  }
+}
+
+//1:1 MATCH OF THE LAST CAPTURE AGAINST ONE ENROLLED ID
+void Verify(int specify_ID)
+{
+  commandPacket.start1 = COMMAND_START_CODE1;
+  commandPacket.start2 = COMMAND_START_CODE2;
+  commandPacket.deviceId = DEVICE_ID;
+  commandPacket.parameter = specify_ID;
+  commandPacket.command = VERIFY;
+  commandPacket.checkSum = CalcChkSumOfCmdAckPkt(&commandPacket);
+
+  send_receive_command();
+}
+
+//1:N MATCH OF THE LAST CAPTURE, ACK PARAMETER IS THE MATCHED ID
+void Identify()
+{
+  commandPacket.start1 = COMMAND_START_CODE1;
+  commandPacket.start2 = COMMAND_START_CODE2;
+  commandPacket.deviceId = DEVICE_ID;
+  commandPacket.parameter = 0x00000000;
+  commandPacket.command = IDENTIFY;
+  commandPacket.checkSum = CalcChkSumOfCmdAckPkt(&commandPacket);
+
+  send_receive_command();
+}
@@ -5,14 +5,19 @@ typedef unsigned long LONG;
 typedef unsigned short SHORT;
 
 //FUNCTION DEFINITION
+void FlushCommands();
 void Open();
 void Close();
+INT ChangeBaudRate(INT baud);
 void LED_open();
 void LED_close();
 void EnrollStart(int specify_ID);
 void Enroll1();
 void Enroll2();
-void Enroll3();
+void Enroll3(INT payload);
 void IsPressFinger();
 void CaptureFinger(LONG picture_quality);
+void GetImage();
+void Verify(int specify_ID);
+void Identify();
 void GetTemplate(int specify_ID);
@@ -3,6 +3,12 @@
 //PACKET LENTGTH
 #define COMMAND_PACKAGE_LENGTH 12 //command packet length
 #define DATA_PACKAGE_LENGTH 504   //data packet length
+#define TEMPLATE_SIZE 498         //template data in the ENROLL3 data packet
+
+//CAPTURED IMAGE (GETIMAGE DATA PACKET CARRIES WIDTH x HEIGHT GREY BYTES)
+#define IMAGE_WIDTH 258
+#define IMAGE_HEIGHT 202
+#define IMAGE_SIZE (IMAGE_WIDTH * IMAGE_HEIGHT)
 
 //PACKET START CODES
 #define COMMAND_START_CODE1 0x55
@@ -12,20 +18,39 @@
 
 #define DEVICE_ID 0x0001
 
+//UART
+#define UART_DEVICE "/dev/ttyS0"
+#define UART_BAUD 9600     //the module's power-on rate, every invocation starts here
+#define IMAGE_BAUD 115200  //the module's fastest rate, used for image transfers
+
 //FUNCTION PARAMETER DEFINITION
 #define OPEN 0x01 //command define
 #define CLOSE 0x02
+#define CHANGE_BAUDRATE 0x04
 #define CMOSLED 0x12
 #define ENROLLSTART 0x22
 #define ENROLL1 0x23
 #define ENROLL2 0x24
 #define ENROLL3 0x25
 #define ISPRESSFINGER 0x26
+#define VERIFY 0x50
+#define IDENTIFY 0x51
 #define CAPTURE_FINGER 0x60
+#define GET_IMAGE 0x62
 #define GETTEMPLATE 0x70
 #define ACK 0x30
 #define NACK 0x31
 
+//NACK PARAMETERS
+#define NACK_VERIFY_FAILED 0x1008
+#define NACK_IDENTIFY_FAILED 0x1009
+#define NACK_BAD_FINGER 0x100C
+#define NACK_FINGER_IS_NOT_PRESSED 0x1012
+
+//HOST-SIDE FAILURES, REPORTED LIKE NACK PARAMETERS
+#define NACK_TEMPLATE_KEY 0x2001    //template key missing or not 16 bytes
+#define NACK_TEMPLATE_STREAM 0x2002 //no record descriptor, corrupt template packet or failed write
+
 typedef struct
 {
 	CHAR start1;
@@ -41,13 +66,15 @@ typedef struct
 	CHAR start1;
 	CHAR start2;
 	SHORT deviceId;
-	CHAR data[498];
+	CHAR data[TEMPLATE_SIZE];
 	SHORT checkSum;
 } DATA_PACKET;
 
+//DEFINED IN command.c
 extern int var;
-LONG returnParameter;
-SHORT returnAck;
+extern CHAR imageData[IMAGE_SIZE];
+extern LONG returnParameter;
+extern SHORT returnAck;
 
-COMMAND_PACKET commandPacket;
-DATA_PACKET dataPacket;
\ No newline at end of file
+extern COMMAND_PACKET commandPacket;
+extern DATA_PACKET dataPacket;
\ No newline at end of file
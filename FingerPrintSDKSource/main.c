@@ -2,6 +2,10 @@
 #include "stdlib.h"
 #include "define.h"
 #include "command.h"
+#include "quality.h"
+#include "match.h"
+#include "state.h"
+#include "template.h"
 #include <string.h>
 #include "wiringPi.h"     //load WiringPi library
 #include "wiringSerial.h" //load WiringPi serial library
@@ -12,10 +16,8 @@ static void print_usage(const char *pcProgramName)
     printf("Usage: %s not run properly\nExamples : %s open\n          %s close\n           %senrol\n          %sisPressfinger\n", pcProgramName);
 }
 
-int var; //UART Handle
-
-/*Main Function Block*/
-int main(int argc, const char *argv[])
+/*Command Block*/
+static int RunCommand(int argc, const char *argv[])
 {
     if (argc < 2)
     {
@@ -37,7 +39,7 @@ int main(int argc, const char *argv[])
     }
 
     // Check UART baudrate between FingerPrint Module & FingerPrint
-    if ((var = serialOpen("/dev/ttyS0", 9600)) < 0)
+    if ((var = serialOpen(UART_DEVICE, UART_BAUD)) < 0)
     {
         printf("Raspberry-UART error!");
         return -1;
@@ -64,6 +66,14 @@ int main(int argc, const char *argv[])
     {
         switchNum = 5;
     }
+    else if (strcmp(command, "verify") == 0)
+    {
+        switchNum = 6;
+    }
+    else if (strcmp(command, "identify") == 0)
+    {
+        switchNum = 7;
+    }
 
     //Case Manipulation
     switch (switchNum)
@@ -71,20 +81,17 @@ int main(int argc, const char *argv[])
     //OPEN
     case 1:
         Open();
+        LED_open();
+        FlushCommands(); //send whichever of Open and LED_open are still needed
         if (returnAck == ACK)
         {
-            LED_open();
-            if (returnAck != ACK)
-            {
-                LED_close();
-                return -1;
-            }
             fprintf(stdout, "SUCCESS"); // we need to exit the code here.
             return 0;                   // 0 or - 1 ?
         }
         else
         {
             {
+                LED_close();
                 fprintf(stdout, "FAIL");
                 return -1;
             }
@@ -129,6 +136,17 @@ int main(int argc, const char *argv[])
     case 4:
     {
         const char *input = argv[2];
+        int gate = 0, payload = TEMPLATE_PAYLOAD_MIN, i;
+
+        //"enroll <n> [image] [payload]": payload sizes the sealed template
+        //records of step 3 to the BLE notify payload
+        for (i = 3; i < argc; i++)
+        {
+            if (strcmp(argv[i], "image") == 0)
+                gate = 1;
+            else
+                payload = atoi(argv[i]);
+        }
 
         int instance = 0;
         if (strcmp(input, "1") == 0)
@@ -163,13 +181,41 @@ int main(int argc, const char *argv[])
             loop_time++;
         }
 
+        //optional host-side quality gate: "enroll <n> image" fetches the
+        //capture and rejects it as a bad finger before spending an enroll
+        //command on it. the image goes over the UART at IMAGE_BAUD, main()
+        //puts the module back at UART_BAUD before exiting
+        if (gate)
+        {
+            QUALITY quality;
+
+            if (ChangeBaudRate(IMAGE_BAUD))
+                GetImage();
+            if (returnAck != ACK)
+            {
+                fprintf(stdout, "ENROLL FAILED ##%lx", returnParameter);
+                LED_close();
+                LED_open();
+                return -1;
+            }
+
+            ScoreImage(imageData, IMAGE_WIDTH, IMAGE_HEIGHT, &quality);
+            if (!QualityAcceptable(&quality))
+            {
+                fprintf(stdout, "ENROLL FAILED ##%x", NACK_BAD_FINGER);
+                LED_close();
+                LED_open();
+                return -1;
+            }
+        }
+
         switch (instance)
         {
         case 41:
             Enroll1();
             if (returnAck != ACK)
             {
-                fprintf(stdout, "ENROLL FAILED ##%x", returnParameter);
+                fprintf(stdout, "ENROLL FAILED ##%lx", returnParameter);
                 LED_close();
             }
             else if ((returnAck == ACK))
@@ -184,7 +230,7 @@ int main(int argc, const char *argv[])
             Enroll2();
             if (returnAck != ACK)
             {
-                fprintf(stdout, "ENROLL FAILED ##%x", returnParameter);
+                fprintf(stdout, "ENROLL FAILED ##%lx", returnParameter);
                 LED_close();
             }
             else if ((returnAck == ACK))
@@ -196,10 +242,10 @@ int main(int argc, const char *argv[])
             return -1;
 
         case 43:
-            Enroll3();
+            Enroll3(payload);
             if (returnAck != ACK)
             {
-                fprintf(stdout, "ENROLL FAILED ##%x", returnParameter);
+                fprintf(stdout, "ENROLL FAILED ##%lx", returnParameter);
             }
             else if ((returnAck == ACK))
             {
@@ -215,14 +261,10 @@ int main(int argc, const char *argv[])
     case 5:
 
         Close();
+        LED_close();
+        FlushCommands(); //send whichever of Close and LED_close are still needed
         if (returnAck == ACK)
         {
-            LED_close();
-            if (returnAck != ACK)
-            {
-                LED_close();
-                return -1;
-            }
             fprintf(stdout, "SUCCESS"); // we need to exit the code here.
             return 0;                   // 0 or - 1 ?
         }
@@ -235,8 +277,40 @@ int main(int argc, const char *argv[])
         }
         break;
 
+    //VERIFY (1:1), RUNS UNTIL KILLED
+    case 6:
+        if (argc < 3)
+        {
+            print_usage(argv[0]);
+            return -1;
+        }
+        return MatchLoop(atoi(argv[2]));
+
+    //IDENTIFY (1:N), RUNS UNTIL KILLED
+    case 7:
+        return MatchLoop(-1);
+
     default:
         print_usage(argv[0]);
         break;
     }
+    return 0;
+}
+
+/*Main Function Block*/
+//the command counters are loaded before and saved after every command, the
+//module model starts unknown each time; state changes still queued at the
+//end are sent before exiting. a command that raised the
+//baud rate leaves the module at UART_BAUD again for the next invocation
+int main(int argc, const char *argv[])
+{
+    int result;
+
+    LoadState();
+    result = RunCommand(argc, argv);
+    FlushCommands();
+    ChangeBaudRate(UART_BAUD);
+    SaveState();
+    PrintStateCounters();
+    return result;
 }
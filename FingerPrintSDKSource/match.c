@@ -0,0 +1,101 @@
+#include "define.h"
+#include "match.h"
+#include "stdio.h"
+#include <signal.h>
+#include "wiringPi.h"
+
+//CONTINUOUS VERIFY/IDENTIFY
+//one line per press goes to stdout as soon as the match is done, so the host
+//can send it over BLE while this loop is already waiting for the next finger.
+
+static volatile sig_atomic_t running = 1;
+
+static void onStop(int signum)
+{
+  (void)signum;
+  running = 0;
+}
+
+static int FingerPressed()
+{
+  IsPressFinger();
+  return returnAck == ACK && returnParameter == 0;
+}
+
+//MATCH EVERY PRESS UNTIL SIGTERM/SIGINT
+//verify_ID < 0 identifies (1:N), otherwise verifies against that ID (1:1).
+//each result line carries per-stage timings in milliseconds:
+//  IDENTIFY ::<id> @wait=<ms>,capture=<ms>,match=<ms>
+//  IDENTIFY FAILED ##<code> @wait=<ms>,capture=<ms>,match=<ms>
+int MatchLoop(int verify_ID)
+{
+  const char *name = verify_ID < 0 ? "IDENTIFY" : "VERIFY";
+
+  signal(SIGTERM, onStop);
+  signal(SIGINT, onStop);
+
+  Open();
+  LED_open();
+  FlushCommands();
+  if (returnAck != ACK)
+  {
+    fprintf(stdout, "FAIL\n");
+    return -1;
+  }
+
+  fprintf(stdout, "%s READY\n", name);
+  fflush(stdout);
+
+  while (running)
+  {
+    unsigned int start = millis(), pressed, captured, matched;
+    int id = -1, tries;
+
+    while (running && !FingerPressed())
+      ;
+    if (!running)
+      break;
+    pressed = millis();
+
+    for (tries = 0; tries < CAPTURE_RETRIES; tries++)
+    {
+      CaptureFinger(0);
+      if (returnAck == ACK)
+        break;
+    }
+    captured = millis();
+
+    if (returnAck == ACK)
+    {
+      if (verify_ID >= 0)
+      {
+        Verify(verify_ID);
+        if (returnAck == ACK)
+          id = verify_ID;
+      }
+      else
+      {
+        Identify();
+        if (returnAck == ACK)
+          id = returnParameter;
+      }
+    }
+    matched = millis();
+
+    if (id >= 0)
+      fprintf(stdout, "%s ::%d", name, id);
+    else
+      fprintf(stdout, "%s FAILED ##%lx", name, returnParameter);
+    fprintf(stdout, " @wait=%u,capture=%u,match=%u\n",
+            pressed - start, captured - pressed, matched - captured);
+    fflush(stdout);
+
+    //one press, one result: hold the next attempt until this finger lifts
+    while (running && FingerPressed())
+      ;
+  }
+
+  LED_close();
+  Close();
+  return 0;
+}
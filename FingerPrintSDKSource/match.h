@@ -0,0 +1,9 @@
+#ifndef MATCH_H
+#define MATCH_H
+
+#define CAPTURE_RETRIES 50
+
+//FUNCTION DEFINITION
+int MatchLoop(int verify_ID);
+
+#endif
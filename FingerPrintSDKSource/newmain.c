@@ -2,6 +2,7 @@
 #include "stdlib.h"
 #include "define.h"
 #include "command.h"
+#include "template.h"
 
 #include "wiringPi.h"     //load WiringPi library
 #include "wiringSerial.h" //load WiringPi serial library
@@ -12,8 +13,6 @@ static void print_usage(const char *pcProgramName)
     printf("Usage: %s not run properly\nExamples : %s open\n          %s close\n           %senrol\n          %sisPressfinger\n", pcProgramName);
 }
 
-int var;
-
 int main(int argc, const char *argv[])
 {
     if (argc < 2)
@@ -185,7 +184,7 @@ int main(int argc, const char *argv[])
             Enroll1();
             if (returnAck != ACK)
             {
-                fprintf(stdout, "ENROLL FAILED ##%x", returnParameter);
+                fprintf(stdout, "ENROLL FAILED ##%lx", returnParameter);
                 LED_close();
             }
             else if ((returnAck == ACK))
@@ -200,7 +199,7 @@ int main(int argc, const char *argv[])
             Enroll2();
             if (returnAck != ACK)
             {
-                fprintf(stdout, "ENROLL FAILED ##%x", returnParameter);
+                fprintf(stdout, "ENROLL FAILED ##%lx", returnParameter);
                 LED_close();
             }
             else if ((returnAck == ACK))
@@ -212,10 +211,10 @@ int main(int argc, const char *argv[])
             return -1;
 
         case 63:
-            Enroll3();
+            Enroll3(TEMPLATE_PAYLOAD_MIN);
             if (returnAck != ACK)
             {
-                fprintf(stdout, "ENROLL FAILED ##%x", returnParameter);
+                fprintf(stdout, "ENROLL FAILED ##%lx", returnParameter);
             }
             else if ((returnAck == ACK))
             {
@@ -0,0 +1,231 @@
+#include "quality.h"
+#include <math.h>
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define QUALITY_NEON
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#define QUALITY_SSE2
+#endif
+
+//BLOCKS FLATTER THAN THIS ARE BACKGROUND (GREY LEVEL VARIANCE)
+#define QUALITY_MIN_VARIANCE 100
+
+//BLOCK STATISTICS (SCALAR REFERENCE)
+//sums grey levels and their squares, plus the gradient structure tensor
+//(gx*gx, gy*gy, gx*gy) from central differences, over one block. the block
+//must not touch the image border.
+void BlockStatsScalar(const CHAR *image, INT stride, INT x0, INT y0, BLOCK_STATS *stats)
+{
+  long sum = 0, sumSq = 0, gxx = 0, gyy = 0, gxy = 0;
+  INT x, y;
+
+  for (y = 0; y < QUALITY_BLOCK; y++)
+  {
+    const CHAR *row = image + (y0 + y) * stride + x0;
+    const CHAR *left = row - 1, *right = row + 1;
+    const CHAR *up = row - stride, *down = row + stride;
+
+    for (x = 0; x < QUALITY_BLOCK; x++)
+    {
+      int c = row[x];
+      int gx = right[x] - left[x];
+      int gy = down[x] - up[x];
+
+      sum += c;
+      sumSq += c * c;
+      gxx += gx * gx;
+      gyy += gy * gy;
+      gxy += gx * gy;
+    }
+  }
+
+  stats->sum = sum;
+  stats->sumSq = sumSq;
+  stats->gxx = gxx;
+  stats->gyy = gyy;
+  stats->gxy = gxy;
+}
+
+#if defined(QUALITY_NEON)
+
+static long SumLanesU32(uint32x4_t v)
+{
+  uint32x2_t s = vadd_u32(vget_low_u32(v), vget_high_u32(v));
+  return vget_lane_u32(vpadd_u32(s, s), 0);
+}
+
+static long SumLanesS32(int32x4_t v)
+{
+  int32x2_t s = vadd_s32(vget_low_s32(v), vget_high_s32(v));
+  return vget_lane_s32(vpadd_s32(s, s), 0);
+}
+
+//BLOCK STATISTICS (NEON, ONE 16 PIXEL ROW PER ITERATION)
+void BlockStats(const CHAR *image, INT stride, INT x0, INT y0, BLOCK_STATS *stats)
+{
+  uint32x4_t sum = vdupq_n_u32(0), sumSq = vdupq_n_u32(0);
+  int32x4_t gxx = vdupq_n_s32(0), gyy = vdupq_n_s32(0), gxy = vdupq_n_s32(0);
+  INT y;
+
+  for (y = 0; y < QUALITY_BLOCK; y++)
+  {
+    const CHAR *row = image + (y0 + y) * stride + x0;
+    uint8x16_t c = vld1q_u8(row);
+    uint8x16_t l = vld1q_u8(row - 1);
+    uint8x16_t r = vld1q_u8(row + 1);
+    uint8x16_t u = vld1q_u8(row - stride);
+    uint8x16_t d = vld1q_u8(row + stride);
+
+    sum = vpadalq_u16(sum, vpaddlq_u8(c));
+    sumSq = vpadalq_u16(sumSq, vmull_u8(vget_low_u8(c), vget_low_u8(c)));
+    sumSq = vpadalq_u16(sumSq, vmull_u8(vget_high_u8(c), vget_high_u8(c)));
+
+    //differences of two bytes always fit a signed 16 bit lane
+    int16x8_t gxLo = vreinterpretq_s16_u16(vsubl_u8(vget_low_u8(r), vget_low_u8(l)));
+    int16x8_t gxHi = vreinterpretq_s16_u16(vsubl_u8(vget_high_u8(r), vget_high_u8(l)));
+    int16x8_t gyLo = vreinterpretq_s16_u16(vsubl_u8(vget_low_u8(d), vget_low_u8(u)));
+    int16x8_t gyHi = vreinterpretq_s16_u16(vsubl_u8(vget_high_u8(d), vget_high_u8(u)));
+
+    gxx = vmlal_s16(gxx, vget_low_s16(gxLo), vget_low_s16(gxLo));
+    gxx = vmlal_s16(gxx, vget_high_s16(gxLo), vget_high_s16(gxLo));
+    gxx = vmlal_s16(gxx, vget_low_s16(gxHi), vget_low_s16(gxHi));
+    gxx = vmlal_s16(gxx, vget_high_s16(gxHi), vget_high_s16(gxHi));
+
+    gyy = vmlal_s16(gyy, vget_low_s16(gyLo), vget_low_s16(gyLo));
+    gyy = vmlal_s16(gyy, vget_high_s16(gyLo), vget_high_s16(gyLo));
+    gyy = vmlal_s16(gyy, vget_low_s16(gyHi), vget_low_s16(gyHi));
+    gyy = vmlal_s16(gyy, vget_high_s16(gyHi), vget_high_s16(gyHi));
+
+    gxy = vmlal_s16(gxy, vget_low_s16(gxLo), vget_low_s16(gyLo));
+    gxy = vmlal_s16(gxy, vget_high_s16(gxLo), vget_high_s16(gyLo));
+    gxy = vmlal_s16(gxy, vget_low_s16(gxHi), vget_low_s16(gyHi));
+    gxy = vmlal_s16(gxy, vget_high_s16(gxHi), vget_high_s16(gyHi));
+  }
+
+  stats->sum = SumLanesU32(sum);
+  stats->sumSq = SumLanesU32(sumSq);
+  stats->gxx = SumLanesS32(gxx);
+  stats->gyy = SumLanesS32(gyy);
+  stats->gxy = SumLanesS32(gxy);
+}
+
+#elif defined(QUALITY_SSE2)
+
+static long SumLanes32(__m128i v)
+{
+  v = _mm_add_epi32(v, _mm_shuffle_epi32(v, _MM_SHUFFLE(1, 0, 3, 2)));
+  v = _mm_add_epi32(v, _mm_shuffle_epi32(v, _MM_SHUFFLE(2, 3, 0, 1)));
+  return _mm_cvtsi128_si32(v);
+}
+
+//BLOCK STATISTICS (SSE2, ONE 16 PIXEL ROW PER ITERATION)
+void BlockStats(const CHAR *image, INT stride, INT x0, INT y0, BLOCK_STATS *stats)
+{
+  __m128i zero = _mm_setzero_si128();
+  __m128i sum = zero, sumSq = zero, gxx = zero, gyy = zero, gxy = zero;
+  INT y;
+
+  for (y = 0; y < QUALITY_BLOCK; y++)
+  {
+    const CHAR *row = image + (y0 + y) * stride + x0;
+    __m128i c = _mm_loadu_si128((const __m128i *)row);
+    __m128i l = _mm_loadu_si128((const __m128i *)(row - 1));
+    __m128i r = _mm_loadu_si128((const __m128i *)(row + 1));
+    __m128i u = _mm_loadu_si128((const __m128i *)(row - stride));
+    __m128i d = _mm_loadu_si128((const __m128i *)(row + stride));
+
+    __m128i cLo = _mm_unpacklo_epi8(c, zero);
+    __m128i cHi = _mm_unpackhi_epi8(c, zero);
+    __m128i gxLo = _mm_sub_epi16(_mm_unpacklo_epi8(r, zero), _mm_unpacklo_epi8(l, zero));
+    __m128i gxHi = _mm_sub_epi16(_mm_unpackhi_epi8(r, zero), _mm_unpackhi_epi8(l, zero));
+    __m128i gyLo = _mm_sub_epi16(_mm_unpacklo_epi8(d, zero), _mm_unpacklo_epi8(u, zero));
+    __m128i gyHi = _mm_sub_epi16(_mm_unpackhi_epi8(d, zero), _mm_unpackhi_epi8(u, zero));
+
+    sum = _mm_add_epi64(sum, _mm_sad_epu8(c, zero));
+    sumSq = _mm_add_epi32(sumSq, _mm_add_epi32(_mm_madd_epi16(cLo, cLo), _mm_madd_epi16(cHi, cHi)));
+    gxx = _mm_add_epi32(gxx, _mm_add_epi32(_mm_madd_epi16(gxLo, gxLo), _mm_madd_epi16(gxHi, gxHi)));
+    gyy = _mm_add_epi32(gyy, _mm_add_epi32(_mm_madd_epi16(gyLo, gyLo), _mm_madd_epi16(gyHi, gyHi)));
+    gxy = _mm_add_epi32(gxy, _mm_add_epi32(_mm_madd_epi16(gxLo, gyLo), _mm_madd_epi16(gxHi, gyHi)));
+  }
+
+  stats->sum = _mm_cvtsi128_si32(sum) + _mm_cvtsi128_si32(_mm_srli_si128(sum, 8));
+  stats->sumSq = SumLanes32(sumSq);
+  stats->gxx = SumLanes32(gxx);
+  stats->gyy = SumLanes32(gyy);
+  stats->gxy = SumLanes32(gxy);
+}
+
+#else
+
+void BlockStats(const CHAR *image, INT stride, INT x0, INT y0, BLOCK_STATS *stats)
+{
+  BlockStatsScalar(image, stride, x0, y0, stats);
+}
+
+#endif
+
+//IMAGE QUALITY SCORE
+//the image is split into blocks; flat blocks are background, the rest are
+//finger. contrast is the mean grey level deviation over finger blocks,
+//coherence the mean ridge orientation coherence over finger blocks and
+//coverage the share of finger blocks. all three are scaled to 0-100.
+void ScoreImage(const CHAR *image, INT width, INT height, QUALITY *quality)
+{
+  const double n = QUALITY_BLOCK * QUALITY_BLOCK;
+  double contrast = 0, coherence = 0;
+  INT blocks = 0, foreground = 0;
+  INT x0, y0;
+  BLOCK_STATS stats;
+
+  //leave a one pixel border for the gradient taps
+  for (y0 = 1; y0 + QUALITY_BLOCK < height; y0 += QUALITY_BLOCK)
+  {
+    for (x0 = 1; x0 + QUALITY_BLOCK < width; x0 += QUALITY_BLOCK)
+    {
+      double mean, variance, energy;
+
+      BlockStats(image, width, x0, y0, &stats);
+      blocks++;
+
+      mean = stats.sum / n;
+      variance = stats.sumSq / n - mean * mean;
+      if (variance < QUALITY_MIN_VARIANCE)
+        continue;
+
+      foreground++;
+      contrast += sqrt(variance);
+
+      energy = (double)stats.gxx + stats.gyy;
+      if (energy > 0)
+        coherence += sqrt((double)(stats.gxx - stats.gyy) * (stats.gxx - stats.gyy) +
+                          4.0 * stats.gxy * stats.gxy) / energy;
+    }
+  }
+
+  quality->contrast = 0;
+  quality->coherence = 0;
+  quality->coverage = blocks ? foreground * 100 / blocks : 0;
+
+  if (foreground)
+  {
+    //a deviation of 64 grey levels is full swing ridges
+    contrast = contrast / foreground * 100 / 64;
+    quality->contrast = contrast > 100 ? 100 : (INT)contrast;
+    quality->coherence = (INT)(coherence / foreground * 100);
+  }
+
+  //noise has contrast and coverage but no orientation, so coherence scales
+  //the whole score
+  quality->score = quality->coherence * (quality->contrast + quality->coverage) / 200;
+}
+
+//QUALITY GATE
+//each of contrast and coverage has a floor of its own, the score alone lets
+//a well covered, faint print through on coherence
+INT QualityAcceptable(const QUALITY *quality)
+{
+  return quality->score >= QUALITY_MIN_SCORE && quality->coverage >= QUALITY_MIN_COVERAGE &&
+         quality->contrast >= QUALITY_MIN_CONTRAST;
+}
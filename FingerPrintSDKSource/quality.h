@@ -0,0 +1,38 @@
+#ifndef QUALITY_H
+#define QUALITY_H
+
+#include "command.h"
+
+//QUALITY GATE THRESHOLDS (0-100)
+#define QUALITY_MIN_SCORE 45
+#define QUALITY_MIN_COVERAGE 40
+#define QUALITY_MIN_CONTRAST 50 //a faint print scores on coherence and coverage alone
+
+//BLOCK SIZE FOR PER-BLOCK STATISTICS
+#define QUALITY_BLOCK 16
+
+typedef struct
+{
+	INT contrast;  //spread of grey levels inside the finger area
+	INT coherence; //how consistently ridges in a block share one orientation
+	INT coverage;  //share of the image covered by finger
+	INT score;     //contrast and coverage, weighted by coherence
+} QUALITY;
+
+//PER-BLOCK SUMS FROM THE SCORING KERNEL
+typedef struct
+{
+	long sum;
+	long sumSq;
+	long gxx;
+	long gyy;
+	long gxy; //signed: ridges running against the diagonal give negative sums
+} BLOCK_STATS;
+
+//FUNCTION DEFINITION
+void ScoreImage(const CHAR *image, INT width, INT height, QUALITY *quality);
+INT QualityAcceptable(const QUALITY *quality);
+void BlockStats(const CHAR *image, INT stride, INT x0, INT y0, BLOCK_STATS *stats);
+void BlockStatsScalar(const CHAR *image, INT stride, INT x0, INT y0, BLOCK_STATS *stats);
+
+#endif
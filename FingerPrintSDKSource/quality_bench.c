@@ -0,0 +1,171 @@
+//IMAGE QUALITY BENCHMARK
+//scores a set of synthetic fingerprint images, fails unless only the good one
+//passes the gate, and reports scoring time per image for the vectorised
+//kernel against the scalar one. needs no module.
+//
+//  gcc -O2 quality_bench.c quality.c -lm -o quality_bench
+//  (on a Raspberry Pi 2/3 add -mfpu=neon-vfpv4 for the NEON kernel)
+
+#include "stdio.h"
+#include "stdlib.h"
+#include <math.h>
+#include <string.h>
+#include <time.h>
+#include "quality.h"
+
+#define IMAGE_WIDTH 258
+#define IMAGE_HEIGHT 202
+#define ITERATIONS 2000
+#define BACKGROUND 230
+
+typedef enum
+{
+  RIDGES,
+  NOISE,
+  BLANK
+} PATTERN;
+
+typedef struct
+{
+  const char *name;
+  PATTERN pattern;
+  int amplitude; //ridge/noise swing in grey levels
+  int noise;     //added sensor noise
+  double top;    //finger area starts this far down the image (0-1)
+  int accept;    //what the gate must decide
+} SAMPLE;
+
+static const SAMPLE samples[] = {
+    {"good", RIDGES, 90, 8, 0.0, 1},
+    {"faint", RIDGES, 18, 4, 0.0, 0},
+    {"partial", RIDGES, 90, 8, 0.65, 0},
+    {"wet", RIDGES, 90, 70, 0.0, 0},
+    {"smudge", NOISE, 90, 0, 0.0, 0},
+    {"blank", BLANK, 0, 4, 0.0, 0},
+};
+
+#define SAMPLE_COUNT (sizeof(samples) / sizeof(samples[0]))
+
+static unsigned int seed = 1;
+
+static int Noise(int amplitude)
+{
+  seed = seed * 1103515245 + 12345;
+  return amplitude ? (int)((seed >> 16) % (2 * amplitude + 1)) - amplitude : 0;
+}
+
+//SYNTHETIC IMAGE: LOOP-TYPE RIDGES IN AN ELLIPTICAL FINGER AREA
+static void MakeImage(const SAMPLE *s, CHAR *image)
+{
+  const double cx = IMAGE_WIDTH / 2.0, cy = IMAGE_HEIGHT * 0.45;
+  int x, y;
+
+  for (y = 0; y < IMAGE_HEIGHT; y++)
+  {
+    for (x = 0; x < IMAGE_WIDTH; x++)
+    {
+      double ex = (x - cx) / (IMAGE_WIDTH * 0.42), ey = (y - IMAGE_HEIGHT / 2.0) / (IMAGE_HEIGHT * 0.48);
+      int inside = ex * ex + ey * ey < 1.0 && y >= s->top * IMAGE_HEIGHT;
+      int v = BACKGROUND;
+
+      if (inside && s->pattern == RIDGES)
+      {
+        double r = sqrt((x - cx) * (x - cx) + 1.6 * (y - cy) * (y - cy));
+        v = 128 + (int)(s->amplitude * sin(r * 2 * M_PI / 9.0));
+      }
+      else if (inside && s->pattern == NOISE)
+        v = 128 + Noise(s->amplitude);
+
+      v += Noise(s->noise);
+      image[y * IMAGE_WIDTH + x] = v < 0 ? 0 : v > 255 ? 255 : v;
+    }
+  }
+}
+
+static double Seconds()
+{
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return t.tv_sec + t.tv_nsec / 1e9;
+}
+
+//ALL BLOCKS OF ONE IMAGE THROUGH EITHER KERNEL
+static long SweepBlocks(const CHAR *image, int scalar)
+{
+  BLOCK_STATS stats;
+  long check = 0;
+  int x0, y0;
+
+  for (y0 = 1; y0 + QUALITY_BLOCK < IMAGE_HEIGHT; y0 += QUALITY_BLOCK)
+    for (x0 = 1; x0 + QUALITY_BLOCK < IMAGE_WIDTH; x0 += QUALITY_BLOCK)
+    {
+      if (scalar)
+        BlockStatsScalar(image, IMAGE_WIDTH, x0, y0, &stats);
+      else
+        BlockStats(image, IMAGE_WIDTH, x0, y0, &stats);
+      check += stats.sum + stats.sumSq + stats.gxx + stats.gyy + stats.gxy;
+    }
+
+  return check;
+}
+
+int main()
+{
+  static CHAR images[SAMPLE_COUNT][IMAGE_WIDTH * IMAGE_HEIGHT];
+  QUALITY quality;
+  double start, scoreTime, kernelTime, scalarTime;
+  long check = 0;
+  unsigned int i, j, wrong = 0;
+
+  printf("%-8s %8s %9s %8s %6s %6s\n", "image", "contrast", "coherence", "coverage", "score", "gate");
+  for (i = 0; i < SAMPLE_COUNT; i++)
+  {
+    MakeImage(&samples[i], images[i]);
+    ScoreImage(images[i], IMAGE_WIDTH, IMAGE_HEIGHT, &quality);
+    printf("%-8s %8u %9u %8u %6u %6s\n", samples[i].name, quality.contrast, quality.coherence,
+           quality.coverage, quality.score, QualityAcceptable(&quality) ? "pass" : "reject");
+
+    if (QualityAcceptable(&quality) != samples[i].accept)
+    {
+      printf("Gate %s %s\n", samples[i].accept ? "rejects" : "passes", samples[i].name);
+      wrong++;
+    }
+
+    if (SweepBlocks(images[i], 0) != SweepBlocks(images[i], 1))
+    {
+      printf("Kernel mismatch on %s\n", samples[i].name);
+      return 1;
+    }
+  }
+
+  start = Seconds();
+  for (j = 0; j < ITERATIONS; j++)
+    for (i = 0; i < SAMPLE_COUNT; i++)
+      ScoreImage(images[i], IMAGE_WIDTH, IMAGE_HEIGHT, &quality);
+  scoreTime = Seconds() - start;
+
+  start = Seconds();
+  for (j = 0; j < ITERATIONS; j++)
+    for (i = 0; i < SAMPLE_COUNT; i++)
+      check += SweepBlocks(images[i], 0);
+  kernelTime = Seconds() - start;
+
+  start = Seconds();
+  for (j = 0; j < ITERATIONS; j++)
+    for (i = 0; i < SAMPLE_COUNT; i++)
+      check -= SweepBlocks(images[i], 1);
+  scalarTime = Seconds() - start;
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+  printf("\nkernel: NEON\n");
+#elif defined(__SSE2__)
+  printf("\nkernel: SSE2\n");
+#else
+  printf("\nkernel: scalar\n");
+#endif
+  printf("ScoreImage:        %8.1f us/image\n", scoreTime * 1e6 / (ITERATIONS * SAMPLE_COUNT));
+  printf("block stats, simd: %8.1f us/image\n", kernelTime * 1e6 / (ITERATIONS * SAMPLE_COUNT));
+  printf("block stats, scalar: %6.1f us/image\n", scalarTime * 1e6 / (ITERATIONS * SAMPLE_COUNT));
+
+  return check != 0 || wrong != 0;
+}
@@ -0,0 +1,135 @@
+#include "define.h"
+#include "state.h"
+#include "stdio.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+MODULE_STATE moduleState;
+
+//MILLISECONDS SINCE BOOT, COMPARABLE BETWEEN PROCESSES
+LONG StateClock()
+{
+  struct timespec now;
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
+
+//FORGET EVERYTHING ABOUT THE MODULE, COUNTERS STAY
+void InvalidateState()
+{
+  moduleState.open = STATE_UNKNOWN;
+  moduleState.led = STATE_UNKNOWN;
+  moduleState.enrollStage = STATE_UNKNOWN;
+}
+
+//CREATE STATE_DIR IF NEEDED, RETURNS 0 UNLESS IT IS A REAL DIRECTORY THAT
+//BELONGS TO US AND THAT NOBODY ELSE CAN WRITE TO
+static int StateDirTrusted()
+{
+  struct stat dir;
+
+  if (mkdir(STATE_DIR, 0700) == -1 && errno != EEXIST)
+    return 0;
+
+  return lstat(STATE_DIR, &dir) == 0 && S_ISDIR(dir.st_mode) &&
+         dir.st_uid == geteuid() && !(dir.st_mode & (S_IWGRP | S_IWOTH));
+}
+
+//READ THE COUNTERS SAVED BY THE LAST INVOCATION, IF THEY ARE RECENT ENOUGH
+//the file must be a regular file of ours and exactly one MODULE_STATE long.
+//the module itself always starts unknown: it may have been reset or power
+//cycled since, and a command skipped on the old model would never be NACKed
+void LoadState()
+{
+  struct stat file;
+  int loaded = 0, fd = -1;
+
+  if (StateDirTrusted())
+    fd = open(STATE_FILE, O_RDONLY | O_NOFOLLOW);
+
+  if (fd != -1)
+  {
+    loaded = fstat(fd, &file) == 0 && S_ISREG(file.st_mode) &&
+             file.st_uid == geteuid() && file.st_size == sizeof(moduleState) &&
+             read(fd, &moduleState, sizeof(moduleState)) == sizeof(moduleState) &&
+             moduleState.magic == STATE_MAGIC &&
+             StateClock() - moduleState.time < STATE_TTL;
+    close(fd);
+  }
+
+  if (!loaded)
+    memset(&moduleState, 0, sizeof(moduleState));
+  InvalidateState();
+}
+
+//O_NOFOLLOW: a link planted at STATE_FILE is never written through
+void SaveState()
+{
+  int fd;
+
+  if (!StateDirTrusted())
+    return;
+
+  fd = open(STATE_FILE, O_WRONLY | O_CREAT | O_TRUNC | O_NOFOLLOW, 0600);
+  if (fd == -1)
+    return;
+
+  moduleState.magic = STATE_MAGIC;
+  moduleState.time = StateClock();
+  if (write(fd, &moduleState, sizeof(moduleState)) != sizeof(moduleState))
+    unlink(STATE_FILE); //the next invocation starts from an unknown module
+  close(fd);
+}
+
+//APPLY THE EFFECT OF ONE ACKNOWLEDGED COMMAND, RESYNC ON NACK
+void UpdateState(SHORT command, LONG parameter, SHORT ack)
+{
+  if (ack != ACK)
+  {
+    InvalidateState();
+    return;
+  }
+
+  switch (command)
+  {
+  case OPEN:
+    moduleState.open = 1;
+    break;
+  case CLOSE:
+    moduleState.open = 0;
+    break;
+  case CMOSLED:
+    moduleState.led = parameter ? 1 : 0;
+    break;
+  case ENROLLSTART:
+    moduleState.enrollStage = 0;
+    moduleState.requested = 0;
+    moduleState.sent = 0;
+    break;
+  case ENROLL1:
+    moduleState.enrollStage = 1;
+    break;
+  case ENROLL2:
+    moduleState.enrollStage = 2;
+    break;
+  case ENROLL3:
+    moduleState.enrollStage = 3;
+    break;
+  }
+}
+
+//COMMANDS SAVED SO FAR IN THIS ENROLLMENT, ON STDERR SO STDOUT STAYS PARSEABLE
+void PrintStateCounters()
+{
+  if (moduleState.requested == 0)
+    return;
+
+  fprintf(stderr, "COMMANDS requested=%u sent=%u saved=%u\n",
+          moduleState.requested, moduleState.sent,
+          moduleState.requested - moduleState.sent);
+}
@@ -0,0 +1,39 @@
+#ifndef STATE_H
+#define STATE_H
+
+#include "command.h"
+
+//HOST-SIDE MODEL OF THE MODULE, TRUSTED FOR ONE SDK INVOCATION
+//only the command counters are kept between invocations; the directory
+//belongs to the SDK's user and only it may write there
+#define STATE_DIR "/run/softcom"
+#define STATE_FILE STATE_DIR "/fingerprint.state"
+#define STATE_MAGIC 0x53544133 //"STA3"
+#define STATE_TTL 30000        //ms; older saved counters start again from zero
+#define STATE_UNKNOWN -1
+
+typedef struct
+{
+	LONG magic;
+	LONG time; //StateClock() when saved
+
+	int open;          //module opened: 1, 0 or STATE_UNKNOWN
+	int led;           //CMOS LED on: 1, 0 or STATE_UNKNOWN
+	int enrollStage;   //0 after EnrollStart, 1-3 after EnrollN, or STATE_UNKNOWN
+
+	//COMMAND COUNTERS, RESET BY EnrollStart
+	INT requested; //command functions called
+	INT sent;      //packets that actually went over the UART
+} MODULE_STATE;
+
+extern MODULE_STATE moduleState;
+
+//FUNCTION DEFINITION
+LONG StateClock();
+void LoadState();
+void SaveState();
+void InvalidateState();
+void UpdateState(SHORT command, LONG parameter, SHORT ack);
+void PrintStateCounters();
+
+#endif
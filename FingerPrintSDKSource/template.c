@@ -0,0 +1,105 @@
+#include "template.h"
+#include "stdio.h"
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+
+//READ length BYTES FROM A FILE; exact ALSO REQUIRES THE FILE TO END THERE
+static INT readFile(const char *name, CHAR *buffer, INT length, INT exact)
+{
+  FILE *pFile = fopen(name, "rb");
+  INT ok;
+
+  if (pFile == NULL)
+    return 0;
+  ok = fread(buffer, 1, length, pFile) == length && (!exact || fgetc(pFile) == EOF);
+  fclose(pFile);
+  return ok;
+}
+
+//WRITE A WHOLE FRAME, RIDING OUT SHORT WRITES
+static INT writeFrame(INT fd, const CHAR *frame)
+{
+  INT length = frame[0] + 1;
+
+  while (length > 0)
+  {
+    ssize_t n = write(fd, frame, length);
+
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n <= 0)
+      return 0;
+    frame += n;
+    length -= n;
+  }
+  return 1;
+}
+
+//START A STREAM: LOAD THE KEY AND PICK A FRESH NONCE SALT
+//payload is the notify payload size records are cut to. returns 0 if the key
+//or the salt cannot be read or the key cannot be set up. nothing is written
+//until the first record.
+INT TemplateStreamOpen(TEMPLATE_STREAM *stream, const char *keyFile, INT fd, INT payload)
+{
+  CHAR raw[AEAD_KEY_LENGTH];
+  INT ok;
+
+  stream->fd = fd;
+  stream->sequence = 0;
+  stream->payload = payload < TEMPLATE_PAYLOAD_MIN   ? TEMPLATE_PAYLOAD_MIN
+                    : payload > TEMPLATE_PAYLOAD_MAX ? TEMPLATE_PAYLOAD_MAX
+                                                     : payload;
+
+  ok = readFile(keyFile, raw, sizeof(raw), 1) &&
+       readFile("/dev/urandom", stream->salt, sizeof(stream->salt), 0) &&
+       AeadSetKey(&stream->key, raw);
+  AeadWipe(raw, sizeof(raw));
+  return ok;
+}
+
+//TEMPLATE BYTES CARRIED BY ONE RECORD
+INT TemplateRecordLength(const TEMPLATE_STREAM *stream)
+{
+  return stream->payload - 1 - TEMPLATE_TAG_LENGTH;
+}
+
+//SEAL length TEMPLATE BYTES SITTING AT frame + TEMPLATE_FRAME_DATA AND WRITE
+//THE FRAME. the first call sends the salt record ahead of it. the nonce is
+//salt || record number, and the record type is authenticated, so records
+//cannot be dropped, reordered or cut short without the receiver noticing.
+INT TemplateStreamSeal(TEMPLATE_STREAM *stream, CHAR *frame, INT length, INT last)
+{
+  CHAR nonce[AEAD_NONCE_LENGTH];
+  CHAR *type = frame + 1, *data = frame + TEMPLATE_FRAME_DATA;
+
+  if (stream->sequence == 0)
+  {
+    CHAR start[TEMPLATE_FRAME_DATA + TEMPLATE_SALT_LENGTH];
+
+    start[0] = 1 + TEMPLATE_SALT_LENGTH;
+    start[1] = RECORD_START;
+    memcpy(start + TEMPLATE_FRAME_DATA, stream->salt, TEMPLATE_SALT_LENGTH);
+    if (!writeFrame(stream->fd, start))
+      return 0;
+  }
+
+  memcpy(nonce, stream->salt, TEMPLATE_SALT_LENGTH);
+  nonce[8] = (CHAR)(stream->sequence >> 24);
+  nonce[9] = (CHAR)(stream->sequence >> 16);
+  nonce[10] = (CHAR)(stream->sequence >> 8);
+  nonce[11] = (CHAR)stream->sequence;
+  stream->sequence++;
+
+  frame[0] = (CHAR)(1 + length + TEMPLATE_TAG_LENGTH);
+  *type = last ? RECORD_LAST : RECORD_DATA;
+  return AeadSeal(&stream->key, nonce, type, 1, data, length, data + length, TEMPLATE_TAG_LENGTH) &&
+         writeFrame(stream->fd, frame);
+}
+
+//FORGET THE KEY
+void TemplateStreamClose(TEMPLATE_STREAM *stream)
+{
+  AeadFreeKey(&stream->key);
+  AeadWipe(stream, sizeof(*stream));
+}
@@ -0,0 +1,44 @@
+#ifndef TEMPLATE_H
+#define TEMPLATE_H
+
+#include "aead.h"
+
+//SHARED AES-128 KEY (16 RAW BYTES), PROVISIONED WITH THE RECEIVING APP
+#define TEMPLATE_KEY_FILE "/etc/softcom/template.key"
+
+//SEALED RECORDS GO OUT ON THIS DESCRIPTOR, STDOUT STAYS FOR STATUS LINES
+#define TEMPLATE_FD 3
+
+//RECORD TYPES (FIRST PAYLOAD BYTE, ALSO THE AAD)
+#define RECORD_START 0x53 //'S', carries the nonce salt
+#define RECORD_DATA 0x44  //'D', template bytes
+#define RECORD_LAST 0x4C  //'L', final template bytes, sent once the packet checksum is good
+
+#define TEMPLATE_SALT_LENGTH 8
+#define TEMPLATE_TAG_LENGTH 8
+
+//ONE RECORD FILLS ONE NOTIFY PAYLOAD (ATT MTU - 3)
+#define TEMPLATE_PAYLOAD_MIN 20
+#define TEMPLATE_PAYLOAD_MAX 255
+
+//FRAME ON TEMPLATE_FD: [payload length][type][data...][tag]
+//callers receive template bytes straight into frame + TEMPLATE_FRAME_DATA
+#define TEMPLATE_FRAME_DATA 2
+#define TEMPLATE_FRAME_MAX (1 + TEMPLATE_PAYLOAD_MAX)
+
+typedef struct
+{
+	AEAD_KEY key;
+	CHAR salt[TEMPLATE_SALT_LENGTH];
+	LONG sequence; //records sealed so far, the low nonce bytes
+	INT fd;
+	INT payload;
+} TEMPLATE_STREAM;
+
+//FUNCTION DEFINITION
+INT TemplateStreamOpen(TEMPLATE_STREAM *stream, const char *keyFile, INT fd, INT payload);
+INT TemplateRecordLength(const TEMPLATE_STREAM *stream);
+INT TemplateStreamSeal(TEMPLATE_STREAM *stream, CHAR *frame, INT length, INT last);
+void TemplateStreamClose(TEMPLATE_STREAM *stream);
+
+#endif
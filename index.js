@@ -1,13 +1,21 @@
 const util = require('util');
-const { spawnSync } = require('child_process');
+const { spawnSync, spawn } = require('child_process');
 const path = require('path');
+const readline = require('readline');
 const bleno = require('bleno');
-const fs = require('fs');
 // const zlib = require('zlib');
 // const convertString = require('convert-string');
 
 const SDKFile = path.join(path.resolve(__dirname, 'FingerPrintSDKSource/SoftcomFingerPrintSDK'));
 
+/**
+ * Score each capture on the host before spending an enroll command on it.
+ * The SDK fetches the image at 115200 baud, which still adds about 4.5 s to
+ * each enroll step, so this is opt-in.
+ * @type {boolean}
+ */
+const ENROLL_QUALITY_GATE = process.env.ENROLL_QUALITY_GATE === '1';
+
 const BlenoPrimaryService = bleno.PrimaryService;
 const BlenoCharacteristic = bleno.Characteristic;
 const BlenoDescriptor = bleno.Descriptor;
@@ -22,29 +30,24 @@ const constructMessage = message => new Buffer.from(message, 'utf8');
 const constructHexMessage = message => new Buffer.from(message, 'hex');
 
 
-const processEnrolledTemplate = async cb => {
-
-	let file = fs.readFileSync(path.resolve(path.join(__dirname, 'tpl.bin')));
-	let chunkSize = 15; // so that we can +i to make it 16bytes
-
-	for (let i = 0; i < (file.length + chunkSize); i += chunkSize) {
-		let chunk = file.slice(i, (i + chunkSize));
-		cb(chunk);
-	}
-	// Template file sent completely.
-	//cb(constructMessage('TEMPLATE COMPLETE'));
-
-	//let templateBMP = fs.readFileSync(path.resolve(path.join(__dirname, 'tpl.bin')));
-
-	//chunkSize = 18;
-
-	//for (let i = 0; i < (templateBMP.length + chunkSize); i += chunkSize) {
-	//	let chunk = templateBMP.slice(i, (i + chunkSize));
-	//	cb(chunk);
-	//}
-	// Template file sent completely.
-	cb(constructMessage('PROCESS COMPLETE'));
-
+/**
+ * Forward the sealed template records from the SDK to BLE as they arrive.
+ * The SDK writes each record as [length][record] and every record fills one
+ * notify payload. Records are ciphertext, so the template is never seen here.
+ * @param cb
+ * @param records The SDK's record stream (fd 3).
+ */
+const processEnrolledTemplate = (cb, records) => {
+	let pending = Buffer.alloc(0);
+
+	records.on('data', data => {
+		// A frame only straddles two reads when the pipe splits it.
+		pending = pending.length ? Buffer.concat([pending, data]) : data;
+		while (pending.length > 0 && pending.length > pending[0]) {
+			cb(pending.subarray(1, 1 + pending[0]));
+			pending = pending.subarray(1 + pending[0]);
+		}
+	});
 };
 
 /**
@@ -83,10 +86,35 @@ const SoftcomFingerPrintSDK = () => {
 		StartEnrollment: async () => await spawnSync(SDKFile, ['start'], options),
 		/**
 		 * Enroll the capture finger {number} times.
+		 * With qualityGate the capture is scored on the host first and a poor one
+		 * comes back as BAD FINGER without reaching the enroll command.
 		 * @param number
+		 * @param qualityGate
 		 * @constructor
 		 */
-		EnrollHostFinger: async (number) => await spawnSync(SDKFile, ['enroll', `${number}`], options),
+		EnrollHostFinger: async (number, qualityGate = false) => await spawnSync(SDKFile,
+			qualityGate ? ['enroll', `${number}`, 'image'] : ['enroll', `${number}`], options),
+		/**
+		 * Run the last enroll step, streaming the new template out sealed.
+		 * Records sized to {payload} come out on fd 3 while the step runs.
+		 * @param payload Notify payload size (ATT MTU - 3).
+		 * @param qualityGate
+		 * @returns {ChildProcess}
+		 * @constructor
+		 */
+		StreamTemplate: (payload, qualityGate = false) => spawn(SDKFile,
+			['enroll', '3', ...(qualityGate ? ['image'] : []), `${payload}`],
+			{ shell: false, stdio: ['ignore', 'pipe', 'pipe', 'pipe'] }),
+		/**
+		 * Start the SDK match loop: verify against {verifyId}, or identify when it is undefined.
+		 * Runs until killed and prints one result line per finger press.
+		 * @param verifyId
+		 * @returns {ChildProcess}
+		 * @constructor
+		 */
+		StartMatching: (verifyId) => spawn(SDKFile,
+			verifyId === undefined ? ['identify'] : ['verify', `${verifyId}`],
+			{ shell: false, stdio: ['ignore', 'pipe', 'inherit'] }),
 	};
 };
 
@@ -104,32 +132,123 @@ async function checkFingerPress(delay = 300) {
 }
 
 async function doEnrollmentCount(count) {
-	const { stdout: EnrolStatus } = await SoftcomFingerPrintSDK()
-	.EnrollHostFinger(count);
+	const { stdout: EnrolStatus, stderr: EnrolCounters } = await SoftcomFingerPrintSDK()
+	.EnrollHostFinger(count, ENROLL_QUALITY_GATE);
 
-	const RESULT = EnrolStatus.toString();
+	// Both are null when the SDK could not be started at all.
+	const RESULT = EnrolStatus ? EnrolStatus.toString() : '';
 	console.log(RESULT, ' RESULT FROM The enrolment');
-	return RESULT.indexOf('::') !== -1 ? RESULT.split('::')[1] : '#' + RESULT.split('##')[1].toUpperCase();
+	// Module commands sent vs. skipped by the SDK state cache so far this enrollment.
+	console.log(EnrolCounters ? EnrolCounters.toString()
+	.trim() : '');
+	return parseEnrollResult(RESULT);
+}
+
+/**
+ * Last enroll step: the template goes out over BLE while the step runs.
+ * @param cb
+ * @param payload Notify payload size (ATT MTU - 3).
+ * @returns {Promise<string>}
+ */
+function doTemplateEnrollment(cb, payload) {
+	const child = SoftcomFingerPrintSDK()
+	.StreamTemplate(payload, ENROLL_QUALITY_GATE);
+	let RESULT = '';
+	let counters = '';
+
+	processEnrolledTemplate(cb, child.stdio[3]);
+	child.stdout.on('data', data => RESULT += data);
+	child.stderr.on('data', data => counters += data);
+
+	// 'close' waits for fd 3 too, so every record has been sent by then.
+	// This runs outside any promise chain, so nothing may throw out of it.
+	return new Promise(resolve => {
+		child.on('error', error => {
+			console.log('Enrollment failed to start: ', error.message);
+			resolve('##UNKNOWN');
+		});
+		child.on('close', () => {
+			try {
+				console.log(RESULT, ' RESULT FROM The enrolment');
+				console.log(counters.trim());
+				resolve(parseEnrollResult(RESULT));
+			} catch (error) {
+				console.log('Enrollment result not understood: ', error.message);
+				resolve('##UNKNOWN');
+			}
+		});
+	});
 }
 
+/**
+ * The error code in SDK output, normalised to the keys of errorHandler.
+ * "ENROLL FAILED ##100c" gives "##100C". Output without a code, a capture
+ * timeout or a missing module, gets a code of its own.
+ * @param RESULT
+ * @returns {string}
+ */
+const parseErrorCode = RESULT => {
+	const code = /##([0-9a-fA-F]+)/.exec(RESULT);
+
+	if (code) {
+		return '##' + code[1].toUpperCase();
+	} else if (RESULT.indexOf('TIMEOUT') !== -1) {
+		return '##TIMEOUT';
+	} else if (RESULT.indexOf('No Fingerprint Module Detected') !== -1) {
+		return '##NO MODULE';
+	}
+	return '##UNKNOWN';
+};
+
+/**
+ * "ENROLL SUCCESS ::<n>" gives <n>, anything else an error code.
+ * @param RESULT
+ * @returns {string}
+ */
+const parseEnrollResult = RESULT => RESULT.indexOf('::') !== -1 ? RESULT.split('::')[1].trim() : parseErrorCode(RESULT);
+
 const errorHandler = (code) => {
 	console.log('Error Code: ', code);
 	const ERROR_MESSAGES = [
 		{
-			code: '##x100C',
+			code: '##100C',
 			message: 'BAD FINGER'
 		},
 		{
-			code: '##x100D',
+			code: '##100D',
 			message: 'ENROLMENT FAILURE, TRY AGAIN'
 		},
 		{
-			code: '##x1012',
+			code: '##1012',
 			message: 'FINGER IS NOT PRESSED'
 		},
 		{
-			code: '##x1001',
+			code: '##1001',
 			message: 'CAPTURE TIMEOUT, TRY AGAIN'
+		},
+		{
+			code: '##1008',
+			message: 'FINGER DOES NOT MATCH'
+		},
+		{
+			code: '##1009',
+			message: 'FINGER NOT RECOGNISED'
+		},
+		{
+			code: '##2001',
+			message: 'TEMPLATE KEY MISSING'
+		},
+		{
+			code: '##2002',
+			message: 'TEMPLATE TRANSFER FAILED'
+		},
+		{
+			code: '##TIMEOUT',
+			message: 'CAPTURE TIMEOUT, TRY AGAIN'
+		},
+		{
+			code: '##NO MODULE',
+			message: 'FINGERPRINT MODULE NOT DETECTED'
 		}
 		// TODO: Add error codes and messages here.
 	];
@@ -143,76 +262,262 @@ const errorHandler = (code) => {
  * Initialize the enrollment process.
  * @param cb
  * @param killProcess
+ * @param payload Notify payload size the template records are cut to.
  * @returns {Promise<void>}
  */
-async function initEnrollment(cb, killProcess = false) {
+async function initEnrollment(cb, killProcess = false, payload = 20) {
 	// let firstRunDone = false;
 	if (!killProcess) {
-		// Open the device.
-		let { stdout: deviceOpen } = await SoftcomFingerPrintSDK()
-		.OpenDevice();
-
-		if (deviceOpen.toString()
-		.trim() === 'SUCCESS') {
-			// Check if finger is pressed while telling the user to press their finger on the device.
-			if (await checkFingerPress(1000)) { // There was a 1second delay that has been removed.
-				const { stdout: EnrolStart } = await SoftcomFingerPrintSDK()
-				.StartEnrollment();
-
-				/**
-				 * Get the unused ID from the `start`
-				 * @type {string}
-				 */
-				const unusedId = EnrolStart.toString()
-				.trim()
-				.split('::')[1];
-				if (unusedId !== undefined) {
-					let j = 1;
-					(function controlledStepLoop(i) {
-						// setTimeout(function () {
-						// 	if (firstRunDone && j > 1) {
-						// 		cb(constructMessage('PLACE FINGER'));
-						// 	}
-						// }, 1000);
-						setTimeout(async function () {
-							let result = await doEnrollmentCount(j);
-							if (!isNaN(result) && j !== 3) { // TODO: Put error cases here to be handled.
-								// cb(constructMessage('REMOVE FINGER'));
-								j++;
-							} else if (!isNaN(result) && j === 3) {
-								/**
-								 * Get file and send to ble for data-beaver.
-								 */
-								return processEnrolledTemplate(cb);
-								// return cb(constructMessage('PROCESS FINISHED'));
-							} else {
-								//TODO:: Remove the negative values of our error code.
-								// Remember to send the negative values.
-								const ERROR = errorHandler(result); // here the result is our error code.
-								return cb(constructMessage(ERROR));
-							}
-							if (--i) controlledStepLoop(i);
-						}, 250);
-					})(3);
+		const generation = enrollGeneration;
+		let started = false;
+		/**
+		 * Ends the enrollment and hands the UART back.
+		 * @param message
+		 */
+		const finish = message => {
+			enrolling = false;
+			return cb(message);
+		};
+
+		enrolling = true;
+		// Until the step loop is running, nothing else will clear the flag.
+		try {
+			// Open the device.
+			let { stdout: deviceOpen } = await SoftcomFingerPrintSDK()
+			.OpenDevice();
+
+			if (deviceOpen.toString()
+			.trim() === 'SUCCESS') {
+				// Check if finger is pressed while telling the user to press their finger on the device.
+				if (await checkFingerPress(1000)) { // There was a 1second delay that has been removed.
+					const { stdout: EnrolStart } = await SoftcomFingerPrintSDK()
+					.StartEnrollment();
+
+					/**
+					 * Get the unused ID from the `start`
+					 * @type {string}
+					 */
+					const unusedId = EnrolStart.toString()
+					.trim()
+					.split('::')[1];
+					if (unusedId !== undefined) {
+						let j = 1;
+						started = true;
+						(function controlledStepLoop(i) {
+							// setTimeout(function () {
+							// 	if (firstRunDone && j > 1) {
+							// 		cb(constructMessage('PLACE FINGER'));
+							// 	}
+							// }, 1000);
+							setTimeout(async function () {
+								// Unsubscribed, or a new enrollment took over.
+								if (generation !== enrollGeneration) {
+									return;
+								}
+								let result;
+								try {
+									enrollStep = j === 3 ? doTemplateEnrollment(cb, payload) : doEnrollmentCount(j);
+									result = await enrollStep;
+								} catch (error) {
+									console.log('Enrollment step failed: ', error.message);
+									return finish(constructMessage('ENROLLMENT FAILED'));
+								}
+								if (generation !== enrollGeneration) {
+									return;
+								}
+								if (!isNaN(result) && j !== 3) { // TODO: Put error cases here to be handled.
+									// cb(constructMessage('REMOVE FINGER'));
+									j++;
+								} else if (!isNaN(result) && j === 3) {
+									/**
+									 * The sealed template has already gone to data-beaver.
+									 */
+									return finish(constructMessage('PROCESS COMPLETE'));
+								} else {
+									//TODO:: Remove the negative values of our error code.
+									// Remember to send the negative values.
+									const ERROR = errorHandler(result); // here the result is our error code.
+									return finish(constructMessage(ERROR));
+								}
+								if (--i) controlledStepLoop(i);
+							}, 250);
+						})(3);
+					}
+				} else {
+					return finish(constructMessage('Finger is not pressed'));
 				}
-			} else {
-				return cb(constructMessage('Finger is not pressed'));
+			}
+		} finally {
+			if (!started) {
+				enrolling = false;
 			}
 		}
 		cb(constructMessage('PLACE FINGER'));
 		// firstRunDone = true;
-	} else {
+	} else if (!matcher) {
+		// A running match loop owns the module and closes it itself.
 		await SoftcomFingerPrintSDK()
 		.CloseDevice();
 	}
 }
 
+/**
+ * Parses a result line from the SDK match loop, e.g.
+ * "IDENTIFY ::3 @wait=812,capture=402,match=215".
+ * @param line
+ * @returns {{id: number, code: string, stages: Object}|null}
+ */
+const parseMatchResult = line => {
+	const [result, timings] = line.trim()
+	.split(' @');
+	if (timings === undefined) {
+		return null;
+	}
+
+	const stages = {};
+	timings.split(',')
+	.forEach(timing => {
+		const [stage, value] = timing.split('=');
+		stages[stage] = Number(value);
+	});
+
+	return result.indexOf('::') !== -1
+		? { id: Number(result.split('::')[1]), stages }
+		: { code: parseErrorCode(result), stages };
+};
+
+/**
+ * Matches per minute and mean per-stage latency over the last minute.
+ * @returns {{add: (function(Object): void), summary: (function(): string)}}
+ * @constructor
+ */
+const MatchStats = () => {
+	const WINDOW = 60000;
+	const started = Date.now();
+	let results = [];
+
+	return {
+		add: stages => {
+			const now = Date.now();
+			results.push(Object.assign({ at: now }, stages));
+			results = results.filter(result => now - result.at < WINDOW);
+		},
+		summary: () => {
+			const elapsed = Math.min(WINDOW, Date.now() - started) || 1;
+			const mean = stage => results.length
+				? Math.round(results.reduce((sum, result) => sum + result[stage], 0) / results.length)
+				: 0;
+
+			return `${(results.length * 60000 / elapsed).toFixed(1)} matches/min, `
+				+ `wait ${mean('wait')}ms, capture ${mean('capture')}ms, match ${mean('match')}ms`;
+		}
+	};
+};
+
+/**
+ * Only one SDK process may talk to the module at a time. The match loop holds
+ * the UART until its process has exited, not just until it has been signalled,
+ * and no match loop starts while an enrollment is running.
+ * @type {{child: ChildProcess, exited: Promise<void>}|null}
+ */
+let matcher = null;
+let matchGeneration = 0;
+let enrolling = false;
+/**
+ * Bumped by every enrollment and unsubscribe; a step loop from an older
+ * enrollment stops at its next step.
+ * @type {number}
+ */
+let enrollGeneration = 0;
+/**
+ * The enroll step whose SDK process currently holds the UART.
+ * @type {Promise<string>}
+ */
+let enrollStep = Promise.resolve();
+
+/**
+ * Stop a running match loop, if any, and cancel one still waiting to start.
+ * @returns {Promise<void>} Resolves once the SDK has exited and released the UART.
+ */
+function stopMatching() {
+	matchGeneration++;
+	if (!matcher) {
+		return Promise.resolve();
+	}
+	matcher.child.kill('SIGTERM');
+	return matcher.exited;
+}
+
+/**
+ * Run the SDK match loop and send each result over BLE as soon as it arrives.
+ * The SDK is already waiting for the next finger while a result is being sent.
+ * Refused while an enrollment is running; subscribe or write again after it.
+ * @param cb
+ * @param verifyId ID to verify against, or undefined to identify.
+ * @returns {Promise<void>}
+ */
+async function startMatching(cb, verifyId) {
+	const stopped = stopMatching();
+	const generation = matchGeneration;
+
+	await stopped;
+	// Stopped or restarted again while the old loop was exiting.
+	if (generation !== matchGeneration) {
+		return;
+	}
+	if (enrolling) {
+		return cb(constructMessage('ENROLLMENT IN PROGRESS'));
+	}
+
+	const child = SoftcomFingerPrintSDK()
+	.StartMatching(verifyId);
+	const stats = MatchStats();
+	let count = 0;
+
+	readline.createInterface({ input: child.stdout })
+	.on('line', line => {
+		if (line.trim() === 'FAIL') {
+			return cb(constructMessage('DEVICE OPEN FAILED'));
+		}
+
+		const result = parseMatchResult(line);
+		if (!result) {
+			return;
+		}
+
+		cb(constructMessage(result.code ? errorHandler(result.code) : `MATCH ::${result.id}`));
+		stats.add(result.stages);
+
+		if (++count % 10 === 0) {
+			console.log('Match stats: ', stats.summary());
+		}
+	});
+
+	const exited = new Promise(resolve => {
+		child.on('exit', () => {
+			console.log('Match stats: ', stats.summary());
+			resolve();
+		});
+		child.on('error', error => {
+			console.log('Match loop failed to start: ', error.message);
+			resolve();
+		});
+	})
+	.then(() => {
+		if (matcher && matcher.child === child) {
+			matcher = null;
+		}
+	});
+
+	matcher = { child, exited };
+}
+
 function FingerprintService() {
 	FingerprintService.super_.call(this, {
 		uuid: '23edd8d170be477db4e30fda81aa8d62',
 		characteristics: [
 			new FingerprintNotifyOnlyCharacteristic(),
-
+			new FingerprintMatchCharacteristic(),
 		]
 	});
 }
@@ -290,8 +595,81 @@ util.inherits(FingerprintNotifyOnlyCharacteristic, BlenoCharacteristic);
 
 FingerprintNotifyOnlyCharacteristic.prototype.onSubscribe = async (maxValueSize = 500, updateCallback) => {
 	console.log(maxValueSize, ' Max value Size');
-	await initEnrollment(updateCallback, false);
+	// Enrollment needs the UART to itself.
+	enrolling = true;
+	const generation = ++enrollGeneration;
+	try {
+		await stopMatching();
+		// Unsubscribed while the match loop was exiting.
+		if (generation === enrollGeneration) {
+			await initEnrollment(updateCallback, false, maxValueSize);
+		}
+	} catch (error) {
+		console.log('Enrollment failed: ', error.message);
+		enrolling = false;
+	}
 };
 FingerprintNotifyOnlyCharacteristic.prototype.onUnsubscribe = async function () {
-	await initEnrollment(null, true);
+	// Stop the step loop, and let the step that holds the UART finish first.
+	enrollGeneration++;
+	try {
+		await enrollStep;
+		await initEnrollment(null, true);
+	} catch (error) {
+		console.log('Enrollment close failed: ', error.message);
+	} finally {
+		enrolling = false;
+	}
+};
+
+//MATCH STARTS//
+//////////////////////////////////////////////////////////
+/**
+ * Subscribing starts identification (1:N). Writing "VERIFY ::<id>" switches to
+ * verification (1:1) against that ID, "IDENTIFY" switches back.
+ * Each finger press is answered with "MATCH ::<id>" or an error message.
+ */
+const FingerprintMatchCharacteristic = function () {
+	FingerprintMatchCharacteristic.super_.call(this, {
+		uuid: 'f6a9f3fc78c74d0aa710efda3e9761bc',
+		properties: ['write', 'notify'],
+		descriptors: [
+			new BlenoDescriptor({
+				uuid: '2901',
+				value: 'match'
+			})
+		]
+	});
+	this.updateCallback = null;
+	this.verifyId = undefined;
+};
+
+util.inherits(FingerprintMatchCharacteristic, BlenoCharacteristic);
+
+FingerprintMatchCharacteristic.prototype.onSubscribe = function (maxValueSize, updateCallback) {
+	this.updateCallback = updateCallback;
+	startMatching(updateCallback, this.verifyId);
+};
+
+FingerprintMatchCharacteristic.prototype.onUnsubscribe = function () {
+	this.updateCallback = null;
+	stopMatching();
+};
+
+FingerprintMatchCharacteristic.prototype.onWriteRequest = function (data, offset, withoutResponse, callback) {
+	const request = data.toString()
+	.trim();
+
+	if (request === 'IDENTIFY') {
+		this.verifyId = undefined;
+	} else if (/^VERIFY ::\d+$/.test(request)) {
+		this.verifyId = Number(request.split('::')[1]);
+	} else {
+		return callback(this.RESULT_UNLIKELY_ERROR);
+	}
+
+	if (this.updateCallback) {
+		startMatching(this.updateCallback, this.verifyId);
+	}
+	callback(this.RESULT_SUCCESS);
 };